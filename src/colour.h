@@ -4,7 +4,8 @@
 
 #include "vec3.h"
 
-void write_colour(std::ostream& out, colour pixel_colour, int samples_per_pixel) {
+// Converts a sum of samples into gamma corrected 8-bit rgb
+inline void colour_to_rgb8(colour pixel_colour, int samples_per_pixel, unsigned char rgb[3]) {
     auto r = pixel_colour.x();
     auto g = pixel_colour.y();
     auto b = pixel_colour.z();
@@ -15,8 +16,16 @@ void write_colour(std::ostream& out, colour pixel_colour, int samples_per_pixel)
     g = sqrt(scale * g);
     b = sqrt(scale * b);
 
-    // Write the translated value between 0 256 inclusive
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.9999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.9999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.9999)) << '\n';
+    // The translated value between 0 256 inclusive
+    rgb[0] = static_cast<unsigned char>(256 * clamp(r, 0.0, 0.9999));
+    rgb[1] = static_cast<unsigned char>(256 * clamp(g, 0.0, 0.9999));
+    rgb[2] = static_cast<unsigned char>(256 * clamp(b, 0.0, 0.9999));
+}
+
+void write_colour(std::ostream& out, colour pixel_colour, int samples_per_pixel) {
+    unsigned char rgb[3];
+    colour_to_rgb8(pixel_colour, samples_per_pixel, rgb);
+    out << static_cast<int>(rgb[0]) << ' '
+        << static_cast<int>(rgb[1]) << ' '
+        << static_cast<int>(rgb[2]) << '\n';
 }
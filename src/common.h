@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -18,9 +19,33 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180;
 }
 
+// Each thread owns its generator state, so worker threads never race on a
+// shared rand() state and a seeded sequence is reproducible.
+inline uint64_t& random_state() {
+    thread_local uint64_t state = 0;
+    return state;
+}
+
+inline void seed_random(uint64_t seed) {
+    random_state() = seed;
+}
+
+// The splitmix64 output function, which scrambles every bit of x into
+// every bit of the result
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t random_uint64() {
+    // splitmix64
+    return mix64(random_state() += 0x9e3779b97f4a7c15ULL);
+}
+
 inline double random_double() {
-    // Returns a random real in [0,1)
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1), using the top 53 bits
+    return (random_uint64() >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
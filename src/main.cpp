@@ -1,11 +1,13 @@
+#include <climits>
 #include <iostream>
+#include <string>
+#include <thread>
 
 #include "camera.h"
 #include "colour.h"
 #include "common.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
+#include "render.h"
+#include "scenes.h"
 
 /**
  * P3 format
@@ -18,6 +20,21 @@
  *
 **/
 
+/**
+ * Usage
+ *
+ * raytracer [--width W] > image.ppm
+ *      Writes the image to stdout as P3, a scanline at a time
+ * raytracer --tiles image.tiles [--width W] [--threads N] [--tile-size N]
+ *      Renders tiles on N threads (default: all cores) and streams them to a
+ *      tiled image, which tile_convert turns into a PPM
+ * --width W
+ *      Image width in pixels (default 768). The height follows the aspect ratio.
+ * --radiance-cache CELL
+ *      Reuses diffuse lighting through a radiance cache with cells CELL
+ *      world units wide. Faster on diffuse scenes, at the cost of some bias.
+**/
+
 double hit_sphere(const point3& centre, double radius, const ray& r) {
     vec3 oc = r.origin() - centre;
     // A vector dotted with itself is the squared length of the vector
@@ -35,142 +52,47 @@ double hit_sphere(const point3& centre, double radius, const ray& r) {
     }
 }
 
-colour ray_colour(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-
-    if (depth <= 0)
-        return colour(0, 0, 0);
-    // Prevents inaccurate hits at t. Ie fixing shadow acne
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        colour attenuation;
-
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_colour(scattered, world, depth - 1);
-
-        return colour(0, 0, 0);
-    }
-    // Create a unit vector of the ray direction
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5 * (unit_direction.y() + 1.0);
-    // First colour is white and second is blue. LERP.
-    return (1.0 - t) * colour(1.0, 1.0, 1.0) + t * colour(0.5, 0.7, 1.0);
-}
-
-hittable_list snowman_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(colour(0.6, 0.1, 0.1));
-    world.add(make_shared<sphere>(point3(0, -1000.0, 0), 1000, ground_material));
-
-    //  Bottom
-    auto material1 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    // Middle
-    auto material2 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(0, 2.3, 0), 0.7, material2));
-
-    // Top
-    auto material3 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(0, 3.2, 0), 0.4, material3));
-
-    // Distant Spheres
-    for (int q = -10; q < 10; q++) {
-        auto albedo = colour::random(0.5, 1);
-        auto fuzz = random_double(0.0, 0.5);
-        auto material = make_shared<metal>(albedo, fuzz);
-        world.add(make_shared<sphere>(point3(q, 0.2, 10.0 * random_double()), 0.2, material));
-    }
-
-    return world;
-}
-
-hittable_list simple_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(colour(0.9, 0.1, 0.1));
-    world.add(make_shared<sphere>(point3(0, -1000.0, 0), 1000, ground_material));
-
-    for (int m = -5; m < 5; m++) {
-        for (int n = 1; n < 3; n++) {
-            auto material_roulette = random_double();
-            point3 centre(m + 0.9 * random_double(), 0.2, n + 0.9 * random_double());
-
-            if ((centre - point3(2, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> material;
-
-                if (material_roulette < 0.8) {
-                    auto albedo = colour::random(0.5, 1);
-                    auto fuzz = random_double(0.0, 0.5);
-                    material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(centre, 0.2, material));
-                } else {
-                    material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(centre, 0.2, material));
-                }
-            }
+int main(int argc, char** argv) {
+    std::string tiles_path;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    int tile_size = 64;
+    double cache_cell_size = 0;
+    long width_option = 768;
+    // --threads and --tile-size only apply to tiled renders
+    bool tiled_options = false;
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--tiles" && a + 1 < argc) {
+            tiles_path = argv[++a];
+        } else if (arg == "--width" && a + 1 < argc) {
+            width_option = atol(argv[++a]);
+        } else if (arg == "--threads" && a + 1 < argc) {
+            threads = atoi(argv[++a]);
+            tiled_options = true;
+        } else if (arg == "--tile-size" && a + 1 < argc) {
+            tile_size = atoi(argv[++a]);
+            tiled_options = true;
+        } else if (arg == "--radiance-cache" && a + 1 < argc) {
+            cache_cell_size = atof(argv[++a]);
+        } else {
+            std::cerr << "Unknown argument: " << arg << '\n';
+            return 2;
         }
     }
-
-    auto material1 = make_shared<metal>(colour(1.0, 0.75, 0.8), 0.0);
-    world.add(make_shared<sphere>(point3(-1, 1, 0), 1.0, material1));
-
-    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(1, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-hittable_list generate_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(colour(0.2, 0.3, 0.2));
-    world.add(make_shared<sphere>(point3(0, -1000.0, 0), 1000, ground_material));
-
-    for (int m = -11; m < 11; m++) {
-        for (int n = -11; n < 11; n++) {
-            auto material_roulette = random_double();
-            point3 centre(m + 0.9 * random_double(), 0.2, n + 0.9 * random_double());
-
-            if ((centre - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> material;
-
-                if (material_roulette < 0.8) {
-                    // Matte, easier to render
-                    auto albedo = colour::random() * colour::random();
-                    material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(centre, 0.2, material));
-                } else if (material_roulette < 0.95) {
-                    // Metal
-                    auto albedo = colour::random(0.5, 1);
-                    auto fuzz = random_double(0.0, 0.5);
-                    material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(centre, 0.2, material));
-                } else {
-                    // Glass
-                    material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(centre, 0.2, material));
-                }
-            }
-        }
+    if (threads < 1)
+        threads = 1;
+    if (tiled_options && tiles_path.empty()) {
+        std::cerr << "--threads and --tile-size need --tiles\n";
+        return 2;
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(colour(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-int main() {
     const auto aspect_ratio = 9.0 / 16.0;
-    const int image_width = 768;
+    if (width_option < 2 || width_option / aspect_ratio > INT_MAX) {
+        std::cerr << "Invalid image width: " << width_option << '\n';
+        return 2;
+    }
+    const int image_width = static_cast<int>(width_option);
     // w/w/h = h
     const int image_height = static_cast<int>(image_width / aspect_ratio);
     const int samples_per_pixel = 100;
@@ -194,6 +116,15 @@ int main() {
     // auto dist_to_focus = 10.0;
     // auto aperture = 0.05;
 
+    // Mesh scene
+    // auto world = mesh_scene("model.obj");
+
+    // point3 lookfrom(0, 2, 10);
+    // point3 lookat(0, 1, 0);
+    // vec3 vup(0, 1, 0);
+    // auto dist_to_focus = 10.0;
+    // auto aperture = 0.0;
+
     // Snowman scene
     auto world = snowman_scene();
 
@@ -204,6 +135,23 @@ int main() {
     auto aperture = 0.05;
 
     camera cam(30, aspect_ratio, lookfrom, lookat, vup, aperture, dist_to_focus);
+    render_settings settings{image_width, image_height, samples_per_pixel, max_depth};
+
+    std::unique_ptr<radiance_cache> cache;
+    if (cache_cell_size > 0) {
+        cache.reset(new radiance_cache(cache_cell_size));
+        settings.cache = cache.get();
+    }
+
+    if (!tiles_path.empty()) {
+        tiled_image_writer out;
+        if (!out.open(tiles_path, image_width, image_height, tile_size))
+            return 1;
+        bool ok = render_tiled(cam, world, settings, threads, out, true) > 0;
+        ok = out.close() && ok;
+        std::cerr << (ok ? "\nDone.\n" : "\nFailed.\n");
+        return ok ? 0 : 1;
+    }
 
     std::cout
         << "P3\n"
@@ -212,18 +160,8 @@ int main() {
     for (int i = image_height - 1; i >= 0; i--) {
         std::cerr << "\rScanlines remaining: " << i << ' ' << std::flush;
         for (int j = 0; j < image_width; j++) {
-            colour pixel_colour(0, 0, 0);
-            // Loop for antialiasing
-            for (int s = 0; s < samples_per_pixel; s++) {
-                auto u = double(j + random_double()) / (image_width - 1);
-                auto v = double(i + random_double()) / (image_height - 1);
-                ray r = cam.get_ray(u, v);
-                // Update the rgb value of each pixel in the image. Reflecting
-                // from the surface.
-                pixel_colour += ray_colour(r, world, max_depth);
-            }
             // Pixels are written out in rows from left to right. With sampling
-            write_colour(std::cout, pixel_colour, samples_per_pixel);
+            write_colour(std::cout, render_pixel(cam, world, settings, i, j), samples_per_pixel);
         }
     }
 
@@ -9,6 +9,9 @@ The materials need to:
 class material {
    public:
     virtual bool scatter(const ray& r_in, const hit_record& rec, colour& attenuation, ray& scattered) const = 0;
+    // True, with the albedo set, when the light leaving the surface is the
+    // same in every direction: the albedo times the average incoming light
+    virtual bool diffuse_albedo(colour& a) const { return false; }
 };
 
 // Utility Functions
@@ -33,6 +36,11 @@ class lambertian : public material {
         return true;
     }
 
+    virtual bool diffuse_albedo(colour& a) const {
+        a = albedo;
+        return true;
+    }
+
    public:
     colour albedo;
 };
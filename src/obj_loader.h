@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "triangle_mesh.h"
+
+/**
+Streaming Wavefront OBJ loader. Only the geometry is read:
+
+v x y z           // vertex position
+f a b c ...       // face, each corner as a, a/t, a/t/n or a//n
+
+The file is read in fixed size chunks and each line is parsed in place, so
+no memory is allocated per line. Polygons with more than three corners are
+split into a triangle fan. All other statements are skipped.
+**/
+
+namespace obj_detail {
+
+inline const char* skip_spaces(const char* s) {
+    while (*s == ' ' || *s == '\t')
+        s++;
+    return s;
+}
+
+// Resolves a 1-based (or negative, relative to the end) OBJ index to a
+// 0-based one. Returns -1 when it is out of range.
+inline long resolve_index(long idx, size_t vertex_count) {
+    if (idx > 0)
+        idx -= 1;
+    else if (idx < 0)
+        idx += static_cast<long>(vertex_count);
+    else
+        return -1;
+    return (idx >= 0 && idx < static_cast<long>(vertex_count)) ? idx : -1;
+}
+
+// Parses a single null terminated line. Returns false on malformed input.
+inline bool parse_line(const char* line, std::vector<point3>& vertices, std::vector<int>& indices) {
+    const char* s = skip_spaces(line);
+
+    if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+        double xyz[3];
+        s += 2;
+        for (int a = 0; a < 3; a++) {
+            char* end;
+            xyz[a] = strtod(s, &end);
+            if (end == s)
+                return false;
+            s = end;
+        }
+        vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+        return true;
+    }
+
+    if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+        long first = -1, prev = -1;
+        int corners = 0;
+        s += 2;
+        while (true) {
+            s = skip_spaces(s);
+            if (*s == '\0' || *s == '\r' || *s == '#')
+                break;
+            char* end;
+            long idx = resolve_index(strtol(s, &end, 10), vertices.size());
+            if (end == s || idx < 0)
+                return false;
+            // Texture and normal indices are not used
+            s = end;
+            while (*s != '\0' && *s != ' ' && *s != '\t' && *s != '\r')
+                s++;
+
+            if (corners == 0) {
+                first = idx;
+            } else if (corners >= 2) {
+                indices.push_back(static_cast<int>(first));
+                indices.push_back(static_cast<int>(prev));
+                indices.push_back(static_cast<int>(idx));
+            }
+            prev = idx;
+            corners++;
+        }
+        return corners >= 3;
+    }
+
+    // Comments, normals, texture coordinates, groups, materials...
+    return true;
+}
+
+}  // namespace obj_detail
+
+// Loads the triangles of an OBJ file into a single mesh. Returns nullptr (and
+// reports why) when the file cannot be read or is malformed.
+shared_ptr<triangle_mesh> load_obj(const std::string& path, shared_ptr<material> m) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Could not open OBJ file: " << path << '\n';
+        return nullptr;
+    }
+
+    // One chunk of the file plus room for a terminating null
+    const size_t chunk_size = 1 << 20;
+    std::vector<char> buffer(chunk_size + 1);
+    std::vector<point3> vertices;
+    std::vector<int> indices;
+
+    size_t filled = 0;
+    long line_number = 0;
+    bool eof = false;
+    bool ok = true;
+
+    while (ok && !eof) {
+        auto count = std::fread(buffer.data() + filled, 1, chunk_size - filled, file);
+        eof = count < chunk_size - filled;
+        filled += count;
+
+        char* start = buffer.data();
+        char* stop = buffer.data() + filled;
+        while (start < stop) {
+            auto newline = static_cast<char*>(std::memchr(start, '\n', stop - start));
+            if (!newline) {
+                // Keep the partial line for the next chunk, unless this is the last one
+                if (!eof)
+                    break;
+                newline = stop;
+            }
+            *newline = '\0';
+            line_number++;
+            if (!obj_detail::parse_line(start, vertices, indices)) {
+                std::cerr << "Malformed OBJ file: " << path << ":" << line_number << '\n';
+                ok = false;
+                break;
+            }
+            start = newline + 1;
+        }
+        if (!ok || eof)
+            break;
+
+        // Move the unfinished line to the front of the buffer
+        filled = stop > start ? stop - start : 0;
+        if (filled == chunk_size) {
+            std::cerr << "OBJ line too long: " << path << ":" << line_number + 1 << '\n';
+            ok = false;
+        }
+        std::memmove(buffer.data(), start, filled);
+    }
+    std::fclose(file);
+
+    if (!ok)
+        return nullptr;
+    return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), m);
+}
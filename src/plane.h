@@ -0,0 +1,36 @@
+#pragma once
+
+#include "hittable.h"
+#include "vec3.h"
+
+// An infinite plane through a point with a given normal. Solving for t is a
+// single division, so it is far cheaper than faking a floor with a huge sphere.
+class plane : public hittable {
+   public:
+    plane(){};
+    plane(point3 p, vec3 n, shared_ptr<material> m) : point(p), normal(unit_vector(n)), mat_ptr(m){};
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+   public:
+    point3 point;
+    vec3 normal;
+    shared_ptr<material> mat_ptr;
+};
+
+bool plane::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    auto denom = dot(r.direction(), normal);
+    // The ray runs parallel to the plane
+    if (fabs(denom) < 1e-12)
+        return false;
+
+    auto t = dot(point - r.origin(), normal) / denom;
+    if (t < t_max && t > t_min) {
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, normal);
+        rec.mat_ptr = mat_ptr;
+        return true;
+    }
+    return false;
+}
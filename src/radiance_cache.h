@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * Radiance cache for diffuse interreflection
+ *
+ * Light leaving a lambertian surface is its albedo times the average light
+ * arriving over the hemisphere, and that incoming light changes slowly across
+ * the surface, so paths bouncing off nearby diffuse points can share one
+ * estimate of it. Space is cut into a grid of cells (split further by the
+ * rough direction of the surface normal), hashed into a fixed size table.
+ * Each cell averages the incoming radiance of the paths traced from it; once
+ * it has enough of them, later bounces landing in the cell take the average
+ * (times their own albedo) instead of tracing on. Caching the light before
+ * the albedo is applied keeps differently coloured surfaces sharing a cell
+ * from taking each other's colour.
+ *
+ * Knobs trading bias for speed:
+ *  cell_size     width of a cell in world units. Bigger cells fill faster and
+ *                blur more lighting detail.
+ *  min_samples   paths a cell averages before it answers lookups. More is
+ *                less noisy but slower to warm up.
+ *  first_bounce  first bounce allowed to use the cache. 0 is the camera ray's
+ *                own hit; the default of 1 always traces one real bounce.
+ *
+ * Insertion is lock-free: a slot is claimed by a compare and swap on its key,
+ * and each sample takes a ticket from the cell before adding to its sums. Only
+ * the first min_samples tickets are accepted, so a cell holds exactly that many
+ * samples once full and its float sums stay small. Lookups only read full
+ * cells, whose sums no longer change, so the average always divides the sums
+ * by the number of samples they hold. Samples arriving at a full cell, or
+ * finding the probe window full, are simply dropped.
+**/
+
+class radiance_cache {
+   public:
+    radiance_cache(double cell, int samples = 16, int first = 1, int capacity_log2 = 20)
+        : cell_size(cell), min_samples(samples), first_bounce(first), mask((size_t(1) << capacity_log2) - 1),
+          cells(size_t(1) << capacity_log2) {}
+
+    // Returns true and sets radiance to the average incoming radiance when the
+    // cell around p has an estimate
+    bool lookup(const point3& p, const vec3& normal, colour& radiance) const;
+    void insert(const point3& p, const vec3& normal, const colour& radiance);
+
+   public:
+    double cell_size;
+    int min_samples;
+    int first_bounce;
+
+   private:
+    struct cache_cell {
+        std::atomic<uint64_t> key{0};
+        // Tickets handed out, and samples added to the sums
+        std::atomic<uint32_t> claimed{0};
+        std::atomic<uint32_t> filled{0};
+        std::atomic<float> sum[3] = {{0}, {0}, {0}};
+    };
+
+    uint64_t cell_key(const point3& p, const vec3& normal, bool jitter) const;
+    static void atomic_add(std::atomic<float>& target, float value);
+
+    // Slots tried after the hashed one before giving up
+    static const int probe_length = 8;
+
+    size_t mask;
+    std::vector<cache_cell> cells;
+};
+
+// Hashes the cell holding p. Lookups jitter p by up to half a cell so they
+// blend neighbouring cells, a stochastic stand-in for trilinear interpolation.
+uint64_t radiance_cache::cell_key(const point3& p, const vec3& normal, bool jitter) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int a = 0; a < 3; a++) {
+        auto offset = jitter ? random_double() - 0.5 : 0.0;
+        auto coord = static_cast<int64_t>(floor(p[a] / cell_size + offset));
+        h = (h ^ static_cast<uint64_t>(coord)) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+
+    // Which of the six axis directions the normal is closest to
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (fabs(normal[a]) > fabs(normal[axis]))
+            axis = a;
+    }
+    h = (h ^ static_cast<uint64_t>(2 * axis + (normal[axis] < 0))) * 0x100000001b3ULL;
+    h ^= h >> 32;
+    // Zero marks an empty slot
+    return h ? h : 1;
+}
+
+void radiance_cache::atomic_add(std::atomic<float>& target, float value) {
+    float current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+    }
+}
+
+bool radiance_cache::lookup(const point3& p, const vec3& normal, colour& radiance) const {
+    auto key = cell_key(p, normal, true);
+    for (int i = 0; i < probe_length; i++) {
+        const auto& c = cells[(key + i) & mask];
+        auto found = c.key.load(std::memory_order_acquire);
+        if (found == 0)
+            return false;
+        if (found != key)
+            continue;
+
+        // Once every ticket's sample is in, the sums are final
+        if (c.filled.load(std::memory_order_acquire) < static_cast<uint32_t>(min_samples))
+            return false;
+        radiance = colour(c.sum[0].load(std::memory_order_relaxed), c.sum[1].load(std::memory_order_relaxed),
+                          c.sum[2].load(std::memory_order_relaxed)) /
+                   min_samples;
+        return true;
+    }
+    return false;
+}
+
+void radiance_cache::insert(const point3& p, const vec3& normal, const colour& radiance) {
+    auto key = cell_key(p, normal, false);
+    for (int i = 0; i < probe_length; i++) {
+        auto& c = cells[(key + i) & mask];
+        // Claim an empty slot, or find the one another thread claimed for this key
+        auto found = c.key.load(std::memory_order_acquire);
+        if (found == 0 && c.key.compare_exchange_strong(found, key, std::memory_order_acq_rel))
+            found = key;
+        if (found != key)
+            continue;
+
+        // Full cells are checked first so the ticket counter stops growing
+        const auto limit = static_cast<uint32_t>(min_samples);
+        if (c.claimed.load(std::memory_order_relaxed) >= limit ||
+            c.claimed.fetch_add(1, std::memory_order_relaxed) >= limit)
+            return;
+        for (int a = 0; a < 3; a++)
+            atomic_add(c.sum[a], static_cast<float>(radiance[a]));
+        c.filled.fetch_add(1, std::memory_order_release);
+        return;
+    }
+}
@@ -0,0 +1,520 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.h"
+#include "common.h"
+#include "obj_loader.h"
+#include "render.h"
+#include "scenes.h"
+
+/**
+ * End to end performance regression suite
+ *
+ * Renders a fixed set of reference scenes with seeded sampling at several
+ * thread counts, reporting wall time, Mrays/s, scaling and peak RSS (each
+ * case runs in its own child process, so the peak is that case's alone). Each
+ * image is compared with the stored reference by RMSE (on the 0-255 scale)
+ * and bias (the relative difference in mean linear intensity, overall and
+ * between channels), and its throughput with the recorded baseline for this machine. Exits non-zero when
+ * any of them regresses past its threshold.
+ *
+ * The courtyard cases check the radiance cache. The scene is rendered with and
+ * without it and both are compared with a converged high sample reference, so
+ * sampling noise makes their RMSE limit looser, while any bias the cache adds
+ * shows up directly. The cached case also times an uncached render and fails
+ * if the cache no longer pays for itself. The albedo cases do the same for red
+ * and blue spheres on a green ground, where a cache that let surfaces take
+ * each other's colour shows up as a colour shift.
+ *
+ * regression [--update-baseline] [--update-references] [--large] [--threads N]
+ *            [--repeats N] [--reference-dir DIR] [--max-rmse X] [--max-noisy-rmse X]
+ *            [--max-bias X] [--max-colour-shift X] [--min-cache-speedup X]
+ *            [--max-slowdown X]
+ *
+ * --update-baseline    record this machine's throughput instead of checking it
+ * --update-references  rewrite the checked in reference images instead of
+ *                      checking against them. Only for intended image changes.
+ * --large          also run the 10^6 sphere scene
+ * --threads N      highest thread count to measure (default: all cores)
+ * --repeats N      renders per measurement, the fastest is kept (default 3)
+ * --max-rmse X     largest accepted RMSE against the reference (default 2)
+ * --max-noisy-rmse X  the same against a converged reference (default 20)
+ * --max-bias X     largest accepted bias, as a fraction (default 0.05)
+ * --max-colour-shift X  largest accepted spread between the biases of the
+ *                  red, green and blue channels (default 0.03)
+ * --min-cache-speedup X  smallest accepted speedup from the cache (default 1.25)
+ * --max-slowdown X largest accepted throughput drop, as a fraction (default 0.1)
+**/
+
+struct regression_case {
+    std::string name;
+    std::function<hittable_list()> build;
+    point3 lookfrom;
+    point3 lookat;
+    double aperture;
+    render_settings settings;
+    // Cell size of the radiance cache, 0 renders without one
+    double cache_cell_size = 0;
+    // When non-zero the reference is rendered at this many samples per pixel
+    // (without the cache), rather than being an earlier render of the case
+    int reference_samples = 0;
+    // Reference image to compare against, when not the case's own
+    std::string reference = "";
+    // Whether the cached render must beat an uncached one. Off for cases that
+    // only check what the cache gets wrong.
+    bool check_cache_speedup = true;
+};
+
+std::vector<regression_case> regression_cases(bool large) {
+    const uint64_t seed = 2020;
+    std::vector<regression_case> cases = {
+        {"generate", generate_scene, point3(13, 2, 3), point3(0, 0, 0), 0.1, {160, 90, 16, 10, seed}},
+        {"simple", simple_scene, point3(0, 2, 10), point3(0, 0, 0), 0.05, {160, 90, 16, 10, seed}},
+        {"snowman", snowman_scene, point3(0, 2, 10), point3(0, 2, 0), 0.05, {160, 90, 16, 10, seed}},
+        {"courtyard", courtyard_scene, point3(7, 3.5, 7), point3(0, 0.8, 0), 0.0, {160, 90, 16, 10, seed}, 0, 256},
+        {"courtyard_cached", courtyard_scene, point3(7, 3.5, 7), point3(0, 0.8, 0), 0.0, {160, 90, 16, 10, seed}, 1.0,
+         256, "courtyard"},
+        {"albedo", albedo_scene, point3(0, 5, 9), point3(0, 0.5, 0), 0.0, {160, 90, 16, 10, seed}, 0, 256},
+        {"albedo_cached", albedo_scene, point3(0, 5, 9), point3(0, 0.5, 0), 0.0, {160, 90, 16, 10, seed}, 2.0, 256,
+         "albedo", false},
+    };
+
+    // Scaled up variants. There is no acceleration structure and every ray
+    // tests every sphere, so the resolution drops as the count grows.
+    std::vector<std::pair<int, render_settings>> scaled = {
+        {10000, {64, 36, 2, 5, seed}},
+        {100000, {32, 18, 1, 3, seed}},
+    };
+    if (large)
+        scaled.push_back({1000000, {16, 9, 1, 3, seed}});
+    for (const auto& variant : scaled) {
+        auto count = variant.first;
+        auto half = ceil(sqrt(static_cast<double>(count)) / 2);
+        cases.push_back({"scaled_" + std::to_string(count), [count]() { return scaled_scene(count); },
+                         point3(half, half / 3 + 2, half / 4), point3(0, 0, 0), 0.0, variant.second});
+    }
+    return cases;
+}
+
+// Converts a ru_maxrss value to MiB
+double rss_mib(long maxrss) {
+#if defined(__APPLE__)
+    return maxrss / (1024.0 * 1024.0);
+#else
+    return maxrss / 1024.0;
+#endif
+}
+
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    out << "P3\n"
+        << width << ' ' << height << "\n255\n";
+    for (size_t p = 0; p < pixels.size(); p += 3)
+        out << static_cast<int>(pixels[p]) << ' ' << static_cast<int>(pixels[p + 1]) << ' '
+            << static_cast<int>(pixels[p + 2]) << '\n';
+    return static_cast<bool>(out);
+}
+
+bool read_ppm(const std::string& path, int& width, int& height, std::vector<unsigned char>& pixels) {
+    std::ifstream in(path);
+    std::string magic;
+    int max_value;
+    if (!(in >> magic >> width >> height >> max_value) || magic != "P3" || max_value != 255)
+        return false;
+    pixels.resize(3 * static_cast<size_t>(width) * height);
+    for (auto& value : pixels) {
+        int v;
+        if (!(in >> v))
+            return false;
+        value = static_cast<unsigned char>(v);
+    }
+    return true;
+}
+
+double rmse(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+    double sum = 0;
+    for (size_t p = 0; p < a.size(); p++) {
+        double d = double(a[p]) - double(b[p]);
+        sum += d * d;
+    }
+    return sqrt(sum / a.size());
+}
+
+// Relative difference in mean intensity, of one channel or (by default) all
+// of them. Pixels are squared back to linear first, since the gamma curve
+// would make noisy images read darker.
+double bias(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b, int channel = -1) {
+    double sum_a = 0, sum_b = 0;
+    for (size_t p = channel < 0 ? 0 : channel; p < a.size(); p += channel < 0 ? 1 : 3) {
+        sum_a += double(a[p]) * a[p];
+        sum_b += double(b[p]) * b[p];
+    }
+    if (sum_b == 0)
+        return sum_a == 0 ? 0 : 1;
+    return sum_a / sum_b - 1;
+}
+
+// Spread between the biases of the three channels. Colour leaking from one
+// surface onto another moves them apart even when the brightness holds.
+double colour_shift(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b) {
+    double low = infinity, high = -infinity;
+    for (int channel = 0; channel < 3; channel++) {
+        auto offset = bias(a, b, channel);
+        low = fmin(low, offset);
+        high = fmax(high, offset);
+    }
+    return high - low;
+}
+
+// Baseline throughput, keyed by "<case> <threads>", in Mrays/s
+std::map<std::string, double> read_baseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::string name;
+    int threads;
+    double mrays;
+    while (in >> name >> threads >> mrays)
+        baseline[name + " " + std::to_string(threads)] = mrays;
+    return baseline;
+}
+
+struct suite_options {
+    bool update_baseline = false;
+    bool update_references = false;
+    std::vector<int> thread_counts;
+    int repeats = 3;
+    std::string reference_dir = "images/reference";
+    double max_rmse = 2.0;
+    double max_noisy_rmse = 20.0;
+    double max_bias = 0.05;
+    double max_colour_shift = 0.03;
+    double min_cache_speedup = 1.25;
+    double max_slowdown = 0.1;
+    std::map<std::string, double> baseline;
+};
+
+// Renders one case at every thread count and checks it against its
+// reference and baseline. Returns false if anything regressed.
+bool run_case(const regression_case& c, const suite_options& o) {
+    auto s = c.settings;
+    bool cached = c.cache_cell_size > 0;
+    bool failed = false;
+    seed_random(s.seed);
+    auto world = c.build();
+    camera cam(30, double(s.image_width) / s.image_height, c.lookfrom, c.lookat, vec3(0, 1, 0), c.aperture,
+               (c.lookfrom - c.lookat).length());
+
+    std::ofstream baseline_out;
+    if (o.update_baseline)
+        baseline_out.open(o.reference_dir + "/throughput.txt", std::ios::app);
+
+    // Renders with the given cache cell size (0 for none) and keeps the
+    // fastest of the repeats to filter out scheduling noise
+    auto measure = [&](double cell_size, int threads, std::vector<unsigned char>& pixels,
+                       unsigned long long& rays) {
+        double wall = infinity;
+        for (int r = 0; r < o.repeats; r++) {
+            // Every render starts from an empty cache
+            std::unique_ptr<radiance_cache> cache;
+            if (cell_size > 0)
+                cache.reset(new radiance_cache(cell_size));
+            s.cache = cache.get();
+
+            auto start = std::chrono::steady_clock::now();
+            rays = render_framebuffer(cam, world, s, threads, pixels);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            wall = fmin(wall, elapsed.count());
+        }
+        s.cache = nullptr;
+        return wall;
+    };
+
+    std::vector<unsigned char> first;
+    double single_thread_mrays = 0;
+    // Timing of the render at the highest thread count
+    double last_wall = 0;
+    unsigned long long last_rays = 0;
+    for (auto threads : o.thread_counts) {
+        std::vector<unsigned char> pixels;
+        unsigned long long rays = 0;
+        double wall = measure(c.cache_cell_size, threads, pixels, rays);
+        last_wall = wall;
+        last_rays = rays;
+
+        auto mrays = rays / wall / 1e6;
+        if (threads == 1)
+            single_thread_mrays = mrays;
+
+        std::string status = "ok";
+        // Sampling is seeded per pixel, so the thread count must not change the
+        // image. Cache contents depend on thread timing, so cached scenes may differ.
+        if (first.empty())
+            first = pixels;
+        else if (pixels != first && !cached)
+            status = "FAIL: image differs from the 1 thread render";
+
+        auto key = c.name + " " + std::to_string(threads);
+        auto base = o.baseline.find(key);
+        if (o.update_baseline) {
+            baseline_out << key << ' ' << mrays << '\n';
+        } else if (base != o.baseline.end()) {
+            if (mrays < base->second * (1 - o.max_slowdown))
+                status = "FAIL: throughput below baseline " + std::to_string(base->second);
+        } else if (status == "ok") {
+            status = "ok (no baseline)";
+        }
+        if (status.compare(0, 4, "FAIL") == 0)
+            failed = true;
+
+        std::cout << std::left << std::setw(16) << c.name << std::right << std::setw(8) << threads
+                  << std::setw(10) << wall << std::setw(10) << mrays << std::setw(10)
+                  << (single_thread_mrays > 0 ? mrays / single_thread_mrays : 0.0) << "  " << status << '\n';
+    }
+
+    // The cache must beat tracing every bounce at the highest thread count
+    if (cached && c.check_cache_speedup) {
+        std::vector<unsigned char> pixels;
+        unsigned long long rays = 0;
+        auto speedup = measure(0, o.thread_counts.back(), pixels, rays) / last_wall;
+        bool slow = speedup < o.min_cache_speedup;
+        std::cout << c.name << ": cache speedup " << speedup << " (" << double(last_rays) / rays
+                  << " of the rays)" << (slow ? "  FAIL" : "  ok") << '\n';
+        if (slow)
+            failed = true;
+    }
+
+    const auto reference_path = o.reference_dir + "/" + (c.reference.empty() ? c.name : c.reference) + ".ppm";
+    if (o.update_references) {
+        if (!c.reference.empty())
+            return !failed;
+        auto reference = first;
+        if (c.reference_samples > 0) {
+            auto settings = c.settings;
+            settings.samples_per_pixel = c.reference_samples;
+            // Seeds are hashed, so the next one gives unrelated samples
+            settings.seed++;
+            render_framebuffer(cam, world, settings, o.thread_counts.back(), reference);
+        }
+        if (!write_ppm(reference_path, s.image_width, s.image_height, reference)) {
+            std::cerr << "Could not write " << reference_path << '\n';
+            failed = true;
+        }
+        return !failed;
+    }
+
+    int width, height;
+    std::vector<unsigned char> reference;
+    if (!read_ppm(reference_path, width, height, reference) || width != s.image_width ||
+        height != s.image_height) {
+        std::cout << c.name << ": FAIL: missing or mismatched reference " << reference_path << '\n';
+        return false;
+    }
+    auto error = rmse(first, reference);
+    auto offset = bias(first, reference);
+    auto shift = colour_shift(first, reference);
+    auto limit = c.reference_samples > 0 ? o.max_noisy_rmse : o.max_rmse;
+    bool wrong = error > limit || fabs(offset) > o.max_bias || shift > o.max_colour_shift;
+    std::cout << c.name << ": rmse " << error << "  bias " << offset << "  colour shift " << shift
+              << (wrong ? "  FAIL" : "  ok") << '\n';
+    if (wrong)
+        failed = true;
+    return !failed;
+}
+
+// Writes a bumpy height field as an OBJ file that uses the awkward parts of
+// the format: quads, every corner form, negative indices, normals, texture
+// coordinates, comments and CRLF line endings. The triangles the loader
+// should produce from it are returned in faces.
+bool write_mesh_obj(const std::string& path, int n, std::vector<point3>& vertices, std::vector<int>& faces) {
+    std::ofstream out(path, std::ios::binary);
+    // Enough digits that the loader reads back exactly these vertices
+    out << std::setprecision(17) << "# regression mesh\r\n";
+    for (int j = 0; j <= n; j++) {
+        for (int i = 0; i <= n; i++) {
+            auto x = 8.0 * i / n - 4, z = 8.0 * j / n - 4;
+            vertices.emplace_back(x, 0.3 * sin(1.3 * x) * cos(0.7 * z), z);
+            const auto& v = vertices.back();
+            out << "v " << v.x() << ' ' << v.y() << ' ' << v.z() << "\r\n"
+                << "vt " << double(i) / n << ' ' << double(j) / n << "\r\n"
+                << "vn 0 1 0\r\n";
+        }
+    }
+    const long count = static_cast<long>(vertices.size());
+    for (int j = 0; j < n; j++) {
+        out << "g row" << j << "\r\n";
+        for (int i = 0; i < n; i++) {
+            long corners[4] = {j * (n + 1L) + i, j * (n + 1L) + i + 1, (j + 1) * (n + 1L) + i + 1,
+                               (j + 1) * (n + 1L) + i};
+            out << 'f';
+            for (int k = 0; k < 4; k++) {
+                // 1-based on even rows, counted back from the end on odd ones
+                long index = j % 2 ? corners[k] - count : corners[k] + 1;
+                switch ((i + k) % 4) {
+                    case 0: out << ' ' << index; break;
+                    case 1: out << ' ' << index << '/' << index; break;
+                    case 2: out << ' ' << index << '/' << index << '/' << index; break;
+                    default: out << ' ' << index << "//" << index; break;
+                }
+            }
+            out << "\r\n";
+            // Quads are split into a fan around their first corner
+            for (int k : {0, 1, 2, 0, 2, 3})
+                faces.push_back(static_cast<int>(corners[k]));
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+// Loads a generated OBJ file and checks that the mesh BVH finds the same
+// closest hits as testing every face. Returns false on any difference.
+bool run_mesh_check() {
+    char path[] = "/tmp/regression_mesh_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cout << "mesh: FAIL: could not create a temporary file\n";
+        return false;
+    }
+    close(fd);
+
+    // Large enough that the loader has to carry lines across its 1 MiB chunks
+    std::vector<point3> vertices;
+    std::vector<int> faces;
+    bool written = write_mesh_obj(path, 160, vertices, faces);
+    auto mesh = written ? load_obj(path, make_shared<lambertian>(colour(0.5, 0.5, 0.5))) : nullptr;
+    std::remove(path);
+    if (!mesh || mesh->face_count() != faces.size() / 3) {
+        std::cout << "mesh: FAIL: the OBJ file did not load as " << faces.size() / 3 << " faces\n";
+        return false;
+    }
+
+    // Rays from all around the field, most of them aimed into it
+    seed_random(2020);
+    const int ray_total = 2000;
+    int hits = 0, mismatches = 0;
+    for (int n = 0; n < ray_total; n++) {
+        point3 origin = 6 * random_in_unit_sphere();
+        point3 target(random_double(-4.5, 4.5), random_double(-0.5, 0.5), random_double(-4.5, 4.5));
+        ray r(origin, target - origin);
+
+        double expected = infinity;
+        for (size_t f = 0; f < faces.size(); f += 3) {
+            const auto& v0 = vertices[faces[f]];
+            hit_triangle(r, v0, vertices[faces[f + 1]] - v0, vertices[faces[f + 2]] - v0, 0.001, expected,
+                         expected);
+        }
+
+        hit_record rec;
+        bool found = mesh->hit(r, 0.001, infinity, rec);
+        if (found != (expected < infinity) || (found && fabs(rec.t - expected) > 1e-9 * fmax(1.0, expected)))
+            mismatches++;
+        hits += found;
+    }
+
+    std::cout << "mesh: " << mesh->face_count() << " faces, " << hits << " of " << ray_total << " rays hit, "
+              << mismatches << " differ from brute force" << (mismatches ? "  FAIL" : "  ok") << '\n';
+    return mismatches == 0;
+}
+
+int main(int argc, char** argv) {
+    suite_options o;
+    bool large = false;
+    int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--update-baseline")
+            o.update_baseline = true;
+        else if (arg == "--update-references")
+            o.update_references = true;
+        else if (arg == "--large")
+            large = true;
+        else if (arg == "--threads" && a + 1 < argc)
+            max_threads = atoi(argv[++a]);
+        else if (arg == "--repeats" && a + 1 < argc)
+            o.repeats = atoi(argv[++a]);
+        else if (arg == "--reference-dir" && a + 1 < argc)
+            o.reference_dir = argv[++a];
+        else if (arg == "--max-rmse" && a + 1 < argc)
+            o.max_rmse = atof(argv[++a]);
+        else if (arg == "--max-noisy-rmse" && a + 1 < argc)
+            o.max_noisy_rmse = atof(argv[++a]);
+        else if (arg == "--max-bias" && a + 1 < argc)
+            o.max_bias = atof(argv[++a]);
+        else if (arg == "--max-colour-shift" && a + 1 < argc)
+            o.max_colour_shift = atof(argv[++a]);
+        else if (arg == "--min-cache-speedup" && a + 1 < argc)
+            o.min_cache_speedup = atof(argv[++a]);
+        else if (arg == "--max-slowdown" && a + 1 < argc)
+            o.max_slowdown = atof(argv[++a]);
+        else {
+            std::cerr << "Unknown argument: " << arg << '\n';
+            return 2;
+        }
+    }
+    if (max_threads < 1)
+        max_threads = 1;
+    if (o.repeats < 1)
+        o.repeats = 1;
+
+    // Doubling thread counts, always ending with the highest
+    for (int t = 1; t < max_threads; t *= 2)
+        o.thread_counts.push_back(t);
+    o.thread_counts.push_back(max_threads);
+
+    // The cases append their own lines to a fresh baseline
+    const std::string baseline_path = o.reference_dir + "/throughput.txt";
+    if (o.update_baseline)
+        std::ofstream(baseline_path, std::ios::trunc);
+    else
+        o.baseline = read_baseline(baseline_path);
+
+    bool failed = false;
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << std::left << std::setw(16) << "scene" << std::right << std::setw(8) << "threads"
+              << std::setw(10) << "wall s" << std::setw(10) << "Mrays/s" << std::setw(10) << "speedup"
+              << "  status\n";
+
+    for (const auto& c : regression_cases(large)) {
+        // Each case runs in a child process, so its peak RSS is its own rather
+        // than the largest of every case so far
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            bool ok = run_case(c, o);
+            std::cout.flush();
+            _exit(ok ? 0 : 1);
+        }
+
+        int status = 0;
+        rusage usage;
+        if (child < 0 || wait4(child, &status, 0, &usage) != child) {
+            std::cout << c.name << ": FAIL: could not run the case\n";
+            failed = true;
+            continue;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = true;
+        std::cout << c.name << ": peak RSS " << rss_mib(usage.ru_maxrss) << " MiB\n";
+    }
+
+    if (!run_mesh_check())
+        failed = true;
+
+    std::cout << (failed ? "Regression suite FAILED\n" : "Regression suite passed\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera.h"
+#include "colour.h"
+#include "common.h"
+#include "hittable.h"
+#include "material.h"
+#include "radiance_cache.h"
+#include "tiled_image.h"
+
+struct render_settings {
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+    int max_depth;
+    // Every pixel derives its own random sequence from this, so an image is
+    // the same whatever order (or on whichever thread) its pixels are rendered
+    uint64_t seed = 0;
+    // Optional cache for diffuse bounces, shared by all threads
+    radiance_cache* cache = nullptr;
+};
+
+// Number of rays traced by the calling thread
+inline unsigned long long& ray_count() {
+    thread_local unsigned long long count = 0;
+    return count;
+}
+
+colour ray_colour(const ray& r, const hittable& world, int depth, radiance_cache* cache = nullptr, int bounce = 0) {
+    hit_record rec;
+
+    if (depth <= 0)
+        return colour(0, 0, 0);
+    ray_count()++;
+    // Prevents inaccurate hits at t. Ie fixing shadow acne
+    if (world.hit(r, 0.001, infinity, rec)) {
+        ray scattered;
+        colour attenuation;
+        colour albedo;
+        colour incoming(0, 0, 0);
+
+        // Diffuse surfaces past the first bounces can answer from the cache.
+        // It holds the light arriving at the surface, not leaving it, so each
+        // surface applies its own albedo and colours do not bleed between
+        // surfaces sharing a cell.
+        bool cacheable = cache && bounce >= cache->first_bounce && rec.mat_ptr->diffuse_albedo(albedo);
+        if (cacheable && cache->lookup(rec.p, rec.normal, incoming))
+            return albedo * incoming;
+
+        colour result(0, 0, 0);
+        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
+            incoming = ray_colour(scattered, world, depth - 1, cache, bounce + 1);
+            result = attenuation * incoming;
+        }
+
+        // Only the first cacheable bounce has most of the path depth left below
+        // it. Deeper bounces are cut short sooner and would darken the cache.
+        if (cacheable && bounce == cache->first_bounce)
+            cache->insert(rec.p, rec.normal, incoming);
+        return result;
+    }
+    // Create a unit vector of the ray direction
+    vec3 unit_direction = unit_vector(r.direction());
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+    // First colour is white and second is blue. LERP.
+    return (1.0 - t) * colour(1.0, 1.0, 1.0) + t * colour(0.5, 0.7, 1.0);
+}
+
+// Returns the sum of all the samples of the pixel in row i (counted from the
+// bottom) and column j
+colour render_pixel(const camera& cam, const hittable& world, const render_settings& settings, int i, int j) {
+    // Hash the seed and the pixel separately, so that changing the seed gives
+    // every pixel an unrelated stream rather than another pixel's
+    uint64_t pixel = (static_cast<uint64_t>(i) << 32) | static_cast<uint32_t>(j);
+    seed_random(mix64(settings.seed) ^ mix64(pixel + 0x9e3779b97f4a7c15ULL));
+
+    colour pixel_colour(0, 0, 0);
+    // Loop for antialiasing
+    for (int s = 0; s < settings.samples_per_pixel; s++) {
+        auto u = double(j + random_double()) / (settings.image_width - 1);
+        auto v = double(i + random_double()) / (settings.image_height - 1);
+        ray r = cam.get_ray(u, v);
+        // Update the rgb value of each pixel in the image. Reflecting
+        // from the surface.
+        pixel_colour += ray_colour(r, world, settings.max_depth, settings.cache);
+    }
+    return pixel_colour;
+}
+
+// Renders the whole image into rgb8 pixels, top row first, with rows shared
+// out between the threads. Returns the number of rays traced.
+unsigned long long render_framebuffer(const camera& cam, const hittable& world, const render_settings& settings,
+                                      int threads, std::vector<unsigned char>& pixels) {
+    pixels.assign(3 * static_cast<size_t>(settings.image_width) * settings.image_height, 0);
+    std::atomic<int> next_row(0);
+    std::atomic<unsigned long long> rays(0);
+
+    auto worker = [&]() {
+        ray_count() = 0;
+        for (int row = next_row++; row < settings.image_height; row = next_row++) {
+            int i = settings.image_height - 1 - row;
+            auto out = pixels.data() + 3 * static_cast<size_t>(row) * settings.image_width;
+            for (int j = 0; j < settings.image_width; j++)
+                colour_to_rgb8(render_pixel(cam, world, settings, i, j), settings.samples_per_pixel, out + 3 * j);
+        }
+        rays += ray_count();
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+    return rays;
+}
+
+// Renders the image tile by tile, with tiles shared out between the threads.
+// Each thread streams its finished tile to the writer, so at most one tile
+// per thread is held in memory however large the image is. Returns the
+// number of rays traced, or 0 if a tile could not be written.
+unsigned long long render_tiled(const camera& cam, const hittable& world, const render_settings& settings,
+                                int threads, tiled_image_writer& out, bool report_progress = false) {
+    const auto& layout = out.layout;
+    std::atomic<int> next_tile(0);
+    std::atomic<int> tiles_done(0);
+    std::atomic<unsigned long long> rays(0);
+    std::atomic<bool> ok(true);
+
+    auto worker = [&]() {
+        ray_count() = 0;
+        std::vector<unsigned char> pixels(3 * static_cast<size_t>(layout.tile_size) * layout.tile_size);
+        for (int tile = next_tile++; tile < layout.tile_count() && ok; tile = next_tile++) {
+            int x0 = (tile % layout.tiles_x()) * layout.tile_size;
+            int y0 = (tile / layout.tiles_x()) * layout.tile_size;
+            int w = layout.tile_width(tile);
+            int h = layout.tile_height(tile);
+            for (int y = 0; y < h; y++) {
+                // Tile rows run top to bottom, image rows i from the bottom
+                int i = settings.image_height - 1 - (y0 + y);
+                for (int x = 0; x < w; x++)
+                    colour_to_rgb8(render_pixel(cam, world, settings, i, x0 + x), settings.samples_per_pixel,
+                                   pixels.data() + 3 * (static_cast<size_t>(y) * w + x));
+            }
+            if (!out.write_tile(tile, pixels.data()))
+                ok = false;
+
+            int done = ++tiles_done;
+            if (report_progress)
+                std::cerr << ("\rTiles remaining: " + std::to_string(layout.tile_count() - done) + ' ') << std::flush;
+        }
+        rays += ray_count();
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+    return ok ? rays.load() : 0;
+}
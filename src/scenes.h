@@ -0,0 +1,223 @@
+#pragma once
+
+#include <string>
+
+#include "common.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "plane.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+hittable_list mesh_scene(const std::string& path) {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.5, 0.5, 0.5));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    auto mesh_material = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.1);
+    auto mesh = load_obj(path, mesh_material);
+    if (mesh)
+        world.add(mesh);
+
+    return world;
+}
+
+hittable_list snowman_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.6, 0.1, 0.1));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    //  Bottom
+    auto material1 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    // Middle
+    auto material2 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(0, 2.3, 0), 0.7, material2));
+
+    // Top
+    auto material3 = make_shared<metal>(colour(0.5, 0.5, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(0, 3.2, 0), 0.4, material3));
+
+    // Distant Spheres
+    for (int q = -10; q < 10; q++) {
+        auto albedo = colour::random(0.5, 1);
+        auto fuzz = random_double(0.0, 0.5);
+        auto material = make_shared<metal>(albedo, fuzz);
+        world.add(make_shared<sphere>(point3(q, 0.2, 10.0 * random_double()), 0.2, material));
+    }
+
+    return world;
+}
+
+hittable_list simple_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.9, 0.1, 0.1));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    for (int m = -5; m < 5; m++) {
+        for (int n = 1; n < 3; n++) {
+            auto material_roulette = random_double();
+            point3 centre(m + 0.9 * random_double(), 0.2, n + 0.9 * random_double());
+
+            if ((centre - point3(2, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> material;
+
+                if (material_roulette < 0.8) {
+                    auto albedo = colour::random(0.5, 1);
+                    auto fuzz = random_double(0.0, 0.5);
+                    material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(centre, 0.2, material));
+                } else {
+                    material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(centre, 0.2, material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<metal>(colour(1.0, 0.75, 0.8), 0.0);
+    world.add(make_shared<sphere>(point3(-1, 1, 0), 1.0, material1));
+
+    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(1, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+hittable_list generate_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.2, 0.3, 0.2));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    for (int m = -11; m < 11; m++) {
+        for (int n = -11; n < 11; n++) {
+            auto material_roulette = random_double();
+            point3 centre(m + 0.9 * random_double(), 0.2, n + 0.9 * random_double());
+
+            if ((centre - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> material;
+
+                if (material_roulette < 0.8) {
+                    // Matte, easier to render
+                    auto albedo = colour::random() * colour::random();
+                    material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(centre, 0.2, material));
+                } else if (material_roulette < 0.95) {
+                    // Metal
+                    auto albedo = colour::random(0.5, 1);
+                    auto fuzz = random_double(0.0, 0.5);
+                    material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(centre, 0.2, material));
+                } else {
+                    // Glass
+                    material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(centre, 0.2, material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(colour(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(colour(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+// A walled courtyard of matte spheres, open only to the sky above, so most
+// light reaches the camera after several diffuse bounces
+hittable_list courtyard_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.7, 0.7, 0.65));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    // Walls of large overlapping spheres under the underside of a huge one,
+    // leaving a band of sky between them as the only way out
+    auto wall_material = make_shared<lambertian>(colour(0.75, 0.7, 0.6));
+    for (int k = -3; k <= 3; k++) {
+        auto along = 3.0 * k;
+        world.add(make_shared<sphere>(point3(along, 0, -13), 6, wall_material));
+        world.add(make_shared<sphere>(point3(along, 0, 13), 6, wall_material));
+        world.add(make_shared<sphere>(point3(-13, 0, along), 6, wall_material));
+        world.add(make_shared<sphere>(point3(13, 0, along), 6, wall_material));
+    }
+    world.add(make_shared<sphere>(point3(0, 47, 0), 40, wall_material));
+
+    for (int m = -6; m < 6; m++) {
+        for (int n = -6; n < 6; n++) {
+            point3 centre(m + 0.9 * random_double(), 0.3, n + 0.9 * random_double());
+            auto albedo = colour::random(0.3, 0.9);
+            world.add(make_shared<sphere>(centre, 0.3, make_shared<lambertian>(albedo)));
+        }
+    }
+
+    auto material1 = make_shared<lambertian>(colour(0.8, 0.3, 0.2));
+    world.add(make_shared<sphere>(point3(0, 1.5, 0), 1.5, material1));
+
+    return world;
+}
+
+// Red and blue matte spheres on a green matte ground. Strongly different
+// albedos side by side show any colour one surface takes from another.
+hittable_list albedo_scene() {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.1, 0.9, 0.1));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    auto red = make_shared<lambertian>(colour(0.9, 0.1, 0.1));
+    for (int m = -3; m <= 3; m++) {
+        for (int n = -3; n <= 3; n++)
+            world.add(make_shared<sphere>(point3(1.5 * m, 0.5, 1.5 * n), 0.5, red));
+    }
+
+    auto blue = make_shared<lambertian>(colour(0.1, 0.1, 0.9));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 1, blue));
+
+    return world;
+}
+
+// generate_scene() scaled up to roughly count small spheres, spread over a
+// square that grows with the count so the density stays the same
+hittable_list scaled_scene(int count) {
+    hittable_list world;
+
+    auto ground_material = make_shared<lambertian>(colour(0.2, 0.3, 0.2));
+    world.add(make_shared<plane>(point3(0, 0, 0), vec3(0, 1, 0), ground_material));
+
+    int half = static_cast<int>(ceil(sqrt(static_cast<double>(count)) / 2));
+    int added = 0;
+    for (int m = -half; m < half && added < count; m++) {
+        for (int n = -half; n < half && added < count; n++, added++) {
+            auto material_roulette = random_double();
+            point3 centre(m + 0.9 * random_double(), 0.2, n + 0.9 * random_double());
+            shared_ptr<material> material;
+
+            if (material_roulette < 0.8) {
+                auto albedo = colour::random() * colour::random();
+                material = make_shared<lambertian>(albedo);
+            } else if (material_roulette < 0.95) {
+                auto albedo = colour::random(0.5, 1);
+                auto fuzz = random_double(0.0, 0.5);
+                material = make_shared<metal>(albedo, fuzz);
+            } else {
+                material = make_shared<dielectric>(1.5);
+            }
+            world.add(make_shared<sphere>(centre, 0.2, material));
+        }
+    }
+
+    return world;
+}
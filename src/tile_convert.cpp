@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tiled_image.h"
+
+/**
+ * Converts a tiled image into a binary (P6) PPM
+ *
+ * tile_convert image.tiles image.ppm
+ *      Converts the whole image, one row of pixels at a time, so memory
+ *      stays at a single row however large the image is
+ * tile_convert image.tiles tile.ppm --tile TX TY
+ *      Extracts a single tile (counted from the top left) without reading
+ *      the rest of the file
+**/
+
+bool write_ppm_header(std::FILE* out, int width, int height) {
+    return std::fprintf(out, "P6\n%d %d\n255\n", width, height) > 0;
+}
+
+bool convert_image(const tiled_image& image, std::FILE* out) {
+    const auto& layout = image.layout;
+    std::vector<unsigned char> row(3 * static_cast<size_t>(layout.width));
+    bool missing = false;
+
+    if (!write_ppm_header(out, layout.width, layout.height))
+        return false;
+    for (int y = 0; y < layout.height; y++) {
+        int ty = y / layout.tile_size;
+        int tile_row = y % layout.tile_size;
+        // Gather this row from every tile it crosses
+        for (int tx = 0; tx < layout.tiles_x(); tx++) {
+            int t = ty * layout.tiles_x() + tx;
+            size_t row_bytes = 3 * static_cast<size_t>(layout.tile_width(t));
+            auto dest = row.data() + 3 * static_cast<size_t>(tx) * layout.tile_size;
+            auto pixels = image.tile(t);
+            if (pixels) {
+                std::memcpy(dest, pixels + tile_row * row_bytes, row_bytes);
+            } else {
+                std::memset(dest, 0, row_bytes);
+                missing = true;
+            }
+        }
+        if (std::fwrite(row.data(), 1, row.size(), out) != row.size())
+            return false;
+    }
+    if (missing)
+        std::cerr << "Some tiles are missing and were left black\n";
+    return true;
+}
+
+// Returns the number of tile (tx, ty), or -1 (and reports why) when there is
+// no such tile or it was never written
+int find_tile(const tiled_image& image, int tx, int ty) {
+    const auto& layout = image.layout;
+    if (tx < 0 || ty < 0 || tx >= layout.tiles_x() || ty >= layout.tiles_y()) {
+        std::cerr << "No such tile: " << tx << ' ' << ty << '\n';
+        return -1;
+    }
+    int t = ty * layout.tiles_x() + tx;
+    if (!image.tile(t)) {
+        std::cerr << "Tile " << tx << ' ' << ty << " was never written\n";
+        return -1;
+    }
+    return t;
+}
+
+bool convert_tile(const tiled_image& image, int t, std::FILE* out) {
+    const auto& layout = image.layout;
+    return write_ppm_header(out, layout.tile_width(t), layout.tile_height(t)) &&
+           std::fwrite(image.tile(t), 1, layout.tile_bytes(t), out) == layout.tile_bytes(t);
+}
+
+int main(int argc, char** argv) {
+    bool single_tile = argc == 6 && std::string(argv[3]) == "--tile";
+    if (argc != 3 && !single_tile) {
+        std::cerr << "Usage: tile_convert image.tiles image.ppm [--tile TX TY]\n";
+        return 2;
+    }
+
+    tiled_image image;
+    if (!image.open(argv[1]))
+        return 1;
+    // Check the tile before creating (and truncating) the output
+    int tile = single_tile ? find_tile(image, atoi(argv[4]), atoi(argv[5])) : -1;
+    if (single_tile && tile < 0)
+        return 1;
+
+    std::FILE* out = std::fopen(argv[2], "wb");
+    if (!out) {
+        std::cerr << "Could not create " << argv[2] << '\n';
+        return 1;
+    }
+    bool ok = single_tile ? convert_tile(image, tile, out) : convert_image(image, out);
+    ok = (std::fclose(out) == 0) && ok;
+    if (!ok)
+        std::cerr << "Could not convert " << argv[1] << '\n';
+    return ok ? 0 : 1;
+}
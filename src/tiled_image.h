@@ -0,0 +1,238 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Tiled image format
+ *
+ * Lets an image be written tile by tile, in any order, without ever holding
+ * the whole frame in memory. All values are in the machine's byte order.
+ *
+ * header      "RTTILES1", uint32 width, height, tile size, 0,
+ *             uint64 offset of the index (0 until the file is finished)
+ * tiles       rgb8 pixels of each tile, rows top first, in the order the
+ *             tiles finished. Edge tiles are cropped to the image.
+ * padding     up to 7 zero bytes so the index is 8 byte aligned
+ * index       one uint64 file offset per tile (0 if the tile is missing),
+ *             tiles numbered left to right, top row first
+**/
+
+struct tiled_image_header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+    uint32_t reserved;
+    uint64_t index_offset;
+};
+
+static const char tiled_image_magic[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '1'};
+
+// Tile geometry shared by the writer and the reader
+class tile_layout {
+   public:
+    tile_layout() : width(0), height(0), tile_size(1) {}
+    tile_layout(int w, int h, int ts) : width(w), height(h), tile_size(ts) {}
+
+    // Whether the sizes are positive and the tiles can be numbered with an int
+    static bool valid(int64_t w, int64_t h, int64_t ts) {
+        if (w <= 0 || h <= 0 || ts <= 0 || w > INT_MAX || h > INT_MAX || ts > INT_MAX)
+            return false;
+        return ((w + ts - 1) / ts) * ((h + ts - 1) / ts) <= INT_MAX;
+    }
+
+    int tiles_x() const { return static_cast<int>((int64_t(width) + tile_size - 1) / tile_size); }
+    int tiles_y() const { return static_cast<int>((int64_t(height) + tile_size - 1) / tile_size); }
+    int tile_count() const { return tiles_x() * tiles_y(); }
+
+    // Edge tiles are cropped to the image
+    int tile_width(int tile) const { return std::min(tile_size, width - (tile % tiles_x()) * tile_size); }
+    int tile_height(int tile) const { return std::min(tile_size, height - (tile / tiles_x()) * tile_size); }
+    size_t tile_bytes(int tile) const { return 3 * static_cast<size_t>(tile_width(tile)) * tile_height(tile); }
+
+   public:
+    int width;
+    int height;
+    int tile_size;
+};
+
+// Appends finished tiles to a tiled image file. write_tile() may be called
+// from several threads at once.
+class tiled_image_writer {
+   public:
+    tiled_image_writer() : file(nullptr), end(0) {}
+    ~tiled_image_writer() { close(); }
+
+    bool open(const std::string& path, int width, int height, int tile_size);
+    // pixels holds layout.tile_bytes(tile) bytes
+    bool write_tile(int tile, const unsigned char* pixels);
+    // Writes the index. The file is incomplete until this succeeds.
+    bool close();
+
+   public:
+    tile_layout layout;
+
+   private:
+    std::FILE* file;
+    uint64_t end;
+    std::vector<uint64_t> index;
+    std::mutex lock;
+};
+
+bool tiled_image_writer::open(const std::string& path, int width, int height, int tile_size) {
+    close();
+    if (!tile_layout::valid(width, height, tile_size)) {
+        std::cerr << "Invalid tiled image size\n";
+        return false;
+    }
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Could not create tiled image: " << path << '\n';
+        return false;
+    }
+
+    layout = tile_layout(width, height, tile_size);
+    index.assign(layout.tile_count(), 0);
+
+    tiled_image_header header = {};
+    std::memcpy(header.magic, tiled_image_magic, sizeof(header.magic));
+    header.width = width;
+    header.height = height;
+    header.tile_size = tile_size;
+    end = sizeof(header);
+    return std::fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool tiled_image_writer::write_tile(int tile, const unsigned char* pixels) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!file || tile < 0 || tile >= layout.tile_count())
+        return false;
+
+    auto bytes = layout.tile_bytes(tile);
+    if (std::fwrite(pixels, 1, bytes, file) != bytes) {
+        std::cerr << "Could not write tile " << tile << '\n';
+        return false;
+    }
+    index[tile] = end;
+    end += bytes;
+    return true;
+}
+
+bool tiled_image_writer::close() {
+    if (!file)
+        return true;
+
+    // Align the index so it can be read in place once mapped
+    const char padding[sizeof(uint64_t)] = {};
+    auto pad = (sizeof(uint64_t) - end % sizeof(uint64_t)) % sizeof(uint64_t);
+    bool ok = std::fwrite(padding, 1, pad, file) == pad;
+    end += pad;
+    ok = ok && std::fwrite(index.data(), sizeof(uint64_t), index.size(), file) == index.size();
+    // Point the header at the index now that it is on disk
+    ok = ok && std::fseek(file, offsetof(tiled_image_header, index_offset), SEEK_SET) == 0;
+    ok = ok && std::fwrite(&end, sizeof(end), 1, file) == 1;
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok)
+        std::cerr << "Could not finish tiled image\n";
+
+    file = nullptr;
+    index.clear();
+    return ok;
+}
+
+// Read-only view of a tiled image file. The file is memory mapped, so
+// reading a tile only touches that tile's pages.
+class tiled_image {
+   public:
+    tiled_image() : data(nullptr), size(0), index(nullptr) {}
+    ~tiled_image() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    // Returns the rgb8 pixels of a tile, or nullptr if it was never written
+    const unsigned char* tile(int t) const { return index[t] ? data + index[t] : nullptr; }
+    const unsigned char* tile(int tx, int ty) const { return tile(ty * layout.tiles_x() + tx); }
+
+   public:
+    tile_layout layout;
+
+   private:
+    const unsigned char* data;
+    size_t size;
+    const uint64_t* index;
+};
+
+bool tiled_image::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open tiled image: " << path << '\n';
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(tiled_image_header)) {
+        std::cerr << "Not a tiled image: " << path << '\n';
+        ::close(fd);
+        return false;
+    }
+    size = info.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not map tiled image: " << path << '\n';
+        size = 0;
+        return false;
+    }
+    data = static_cast<const unsigned char*>(mapped);
+
+    // Every value read from the file is untrusted. The bounds checks below
+    // subtract from values already known to be in range, so none can wrap.
+    tiled_image_header header;
+    std::memcpy(&header, data, sizeof(header));
+    bool ok = std::memcmp(header.magic, tiled_image_magic, sizeof(header.magic)) == 0 &&
+              tile_layout::valid(header.width, header.height, header.tile_size);
+    if (ok) {
+        layout = tile_layout(header.width, header.height, header.tile_size);
+        auto offset = header.index_offset;
+        ok = offset >= sizeof(header) && offset <= size && offset % sizeof(uint64_t) == 0 &&
+             (size - offset) / sizeof(uint64_t) >= static_cast<uint64_t>(layout.tile_count());
+    }
+    if (ok) {
+        index = reinterpret_cast<const uint64_t*>(data + header.index_offset);
+        // Every tile must lie between the header and the index
+        for (int t = 0; t < layout.tile_count() && ok; t++) {
+            auto bytes = layout.tile_bytes(t);
+            ok = index[t] == 0 ||
+                 (index[t] >= sizeof(header) && bytes <= header.index_offset && index[t] <= header.index_offset - bytes);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Corrupt or unfinished tiled image: " << path << '\n';
+        close();
+        return false;
+    }
+    return true;
+}
+
+void tiled_image::close() {
+    if (data)
+        munmap(const_cast<unsigned char*>(data), size);
+    data = nullptr;
+    size = 0;
+    index = nullptr;
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#include "hittable.h"
+#include "vec3.h"
+
+// Moller-Trumbore ray/triangle test. Returns true and sets t when the ray
+// crosses the triangle (v0, v0 + e1, v0 + e2) strictly inside (t_min, t_max).
+inline bool hit_triangle(const ray& r, const point3& v0, const vec3& e1, const vec3& e2,
+                         double t_min, double t_max, double& t) {
+    vec3 pvec = cross(r.direction(), e2);
+    auto det = dot(e1, pvec);
+    // The ray is parallel to the triangle (or the triangle is degenerate)
+    if (fabs(det) < 1e-12)
+        return false;
+
+    auto inv_det = 1.0 / det;
+    vec3 tvec = r.origin() - v0;
+    // Barycentric coordinates of the crossing point
+    auto u = dot(tvec, pvec) * inv_det;
+    if (u < 0 || u > 1)
+        return false;
+    vec3 qvec = cross(tvec, e1);
+    auto v = dot(r.direction(), qvec) * inv_det;
+    if (v < 0 || u + v > 1)
+        return false;
+
+    auto temp = dot(e2, qvec) * inv_det;
+    if (temp < t_max && temp > t_min) {
+        t = temp;
+        return true;
+    }
+    return false;
+}
+
+// Four triangles stored component by component (structure of arrays) so a
+// single pass of the kernel can test all of them at once. Unused lanes hold
+// degenerate triangles, which the determinant check always rejects.
+struct alignas(32) triangle_block {
+    double v0x[4], v0y[4], v0z[4];
+    double e1x[4], e1y[4], e1z[4];
+    double e2x[4], e2y[4], e2z[4];
+};
+
+// Tests a ray against the four triangles of a block. Returns the lane of the
+// closest hit within (t_min, t_max) and sets t, or -1 when nothing is hit.
+inline int hit_triangle_block(const triangle_block& b, const ray& r, double t_min, double t_max, double& t) {
+    int lane = -1;
+#if defined(__AVX__)
+    const __m256d ox = _mm256_set1_pd(r.orig.x());
+    const __m256d oy = _mm256_set1_pd(r.orig.y());
+    const __m256d oz = _mm256_set1_pd(r.orig.z());
+    const __m256d dx = _mm256_set1_pd(r.dir.x());
+    const __m256d dy = _mm256_set1_pd(r.dir.y());
+    const __m256d dz = _mm256_set1_pd(r.dir.z());
+
+    const __m256d e1x = _mm256_load_pd(b.e1x);
+    const __m256d e1y = _mm256_load_pd(b.e1y);
+    const __m256d e1z = _mm256_load_pd(b.e1z);
+    const __m256d e2x = _mm256_load_pd(b.e2x);
+    const __m256d e2y = _mm256_load_pd(b.e2y);
+    const __m256d e2z = _mm256_load_pd(b.e2z);
+
+    // pvec = d x e2
+    __m256d px = _mm256_sub_pd(_mm256_mul_pd(dy, e2z), _mm256_mul_pd(dz, e2y));
+    __m256d py = _mm256_sub_pd(_mm256_mul_pd(dz, e2x), _mm256_mul_pd(dx, e2z));
+    __m256d pz = _mm256_sub_pd(_mm256_mul_pd(dx, e2y), _mm256_mul_pd(dy, e2x));
+    __m256d det = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e1x, px), _mm256_mul_pd(e1y, py)),
+                                _mm256_mul_pd(e1z, pz));
+    __m256d inv_det = _mm256_div_pd(_mm256_set1_pd(1.0), det);
+
+    // tvec = o - v0
+    __m256d tx = _mm256_sub_pd(ox, _mm256_load_pd(b.v0x));
+    __m256d ty = _mm256_sub_pd(oy, _mm256_load_pd(b.v0y));
+    __m256d tz = _mm256_sub_pd(oz, _mm256_load_pd(b.v0z));
+    __m256d u = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(tx, px), _mm256_mul_pd(ty, py)),
+                                            _mm256_mul_pd(tz, pz)),
+                              inv_det);
+
+    // qvec = tvec x e1
+    __m256d qx = _mm256_sub_pd(_mm256_mul_pd(ty, e1z), _mm256_mul_pd(tz, e1y));
+    __m256d qy = _mm256_sub_pd(_mm256_mul_pd(tz, e1x), _mm256_mul_pd(tx, e1z));
+    __m256d qz = _mm256_sub_pd(_mm256_mul_pd(tx, e1y), _mm256_mul_pd(ty, e1x));
+    __m256d v = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, qx), _mm256_mul_pd(dy, qy)),
+                                            _mm256_mul_pd(dz, qz)),
+                              inv_det);
+    __m256d dist = _mm256_mul_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(e2x, qx), _mm256_mul_pd(e2y, qy)),
+                                               _mm256_mul_pd(e2z, qz)),
+                                 inv_det);
+
+    // Clearing the sign bit gives |det|
+    const __m256d abs_det = _mm256_andnot_pd(_mm256_set1_pd(-0.0), det);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d mask = _mm256_cmp_pd(abs_det, _mm256_set1_pd(1e-12), _CMP_GE_OQ);
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(_mm256_add_pd(u, v), _mm256_set1_pd(1.0), _CMP_LE_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(dist, _mm256_set1_pd(t_min), _CMP_GT_OQ));
+    mask = _mm256_and_pd(mask, _mm256_cmp_pd(dist, _mm256_set1_pd(t_max), _CMP_LT_OQ));
+
+    int hits = _mm256_movemask_pd(mask);
+    if (hits == 0)
+        return -1;
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, dist);
+    for (int i = 0; i < 4; i++) {
+        if ((hits & (1 << i)) && lanes[i] < t_max) {
+            t_max = lanes[i];
+            lane = i;
+        }
+    }
+#else
+    // Without AVX fall back to the scalar kernel, one lane at a time
+    for (int i = 0; i < 4; i++) {
+        if (hit_triangle(r, point3(b.v0x[i], b.v0y[i], b.v0z[i]), vec3(b.e1x[i], b.e1y[i], b.e1z[i]),
+                         vec3(b.e2x[i], b.e2y[i], b.e2z[i]), t_min, t_max, t_max))
+            lane = i;
+    }
+#endif
+    if (lane >= 0)
+        t = t_max;
+    return lane;
+}
+
+// Node of the bounding volume hierarchy over a mesh's faces. Bounds are
+// stored as floats rounded outwards, which keeps a node at 32 bytes.
+struct mesh_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    // Leaf: first face. Inner node: index of the second child (the first
+    // child always follows its parent).
+    uint32_t offset;
+    // Faces in a leaf (at most four, one kernel block), 0 for inner nodes
+    uint16_t count;
+    // Axis the children were split along
+    uint16_t axis;
+};
+
+// A triangle mesh sharing one vertex buffer and one index buffer (three
+// indices per face), rather than one heap allocated object per triangle.
+// Faces are reordered so each BVH leaf covers up to four consecutive faces,
+// which are gathered into a block for the four-wide kernel only once a ray
+// reaches the leaf.
+class triangle_mesh : public hittable {
+   public:
+    triangle_mesh(){};
+    triangle_mesh(std::vector<point3> verts, std::vector<int> idx, shared_ptr<material> m);
+
+    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const;
+
+    size_t face_count() const { return indices.size() / 3; }
+
+   private:
+    uint32_t build_node(std::vector<int>& order, const std::vector<point3>& centroids, size_t begin, size_t end);
+    void gather_block(const mesh_bvh_node& leaf, triangle_block& b) const;
+
+   public:
+    std::vector<point3> vertices;
+    std::vector<int> indices;
+    shared_ptr<material> mat_ptr;
+    std::vector<mesh_bvh_node> nodes;
+};
+
+triangle_mesh::triangle_mesh(std::vector<point3> verts, std::vector<int> idx, shared_ptr<material> m)
+    : vertices(std::move(verts)), indices(std::move(idx)), mat_ptr(m) {
+    auto faces = face_count();
+    if (faces == 0)
+        return;
+
+    std::vector<int> order(faces);
+    std::vector<point3> centroids(faces);
+    for (size_t f = 0; f < faces; f++) {
+        order[f] = static_cast<int>(f);
+        centroids[f] = (vertices[indices[3 * f]] + vertices[indices[3 * f + 1]] + vertices[indices[3 * f + 2]]) / 3;
+    }
+    // A full binary tree over leaves of four faces
+    nodes.reserve(2 * ((faces + 3) / 4));
+    build_node(order, centroids, 0, faces);
+
+    // Put the index buffer in leaf order
+    std::vector<int> sorted(indices.size());
+    for (size_t f = 0; f < faces; f++) {
+        for (int k = 0; k < 3; k++)
+            sorted[3 * f + k] = indices[3 * order[f] + k];
+    }
+    indices.swap(sorted);
+}
+
+// Builds the subtree over faces order[begin, end) and returns its node
+uint32_t triangle_mesh::build_node(std::vector<int>& order, const std::vector<point3>& centroids, size_t begin,
+                                   size_t end) {
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    point3 bounds_min(infinity, infinity, infinity), bounds_max(-infinity, -infinity, -infinity);
+    point3 centre_min = bounds_min, centre_max = bounds_max;
+    for (size_t i = begin; i < end; i++) {
+        auto f = order[i];
+        for (int a = 0; a < 3; a++) {
+            for (int k = 0; k < 3; k++) {
+                auto v = vertices[indices[3 * f + k]][a];
+                bounds_min[a] = fmin(bounds_min[a], v);
+                bounds_max[a] = fmax(bounds_max[a], v);
+            }
+            centre_min[a] = fmin(centre_min[a], centroids[f][a]);
+            centre_max[a] = fmax(centre_max[a], centroids[f][a]);
+        }
+    }
+
+    mesh_bvh_node node = {};
+    for (int a = 0; a < 3; a++) {
+        // Round outwards so the float box still holds every vertex
+        node.bounds_min[a] = std::nextafter(static_cast<float>(bounds_min[a]), -std::numeric_limits<float>::infinity());
+        node.bounds_max[a] = std::nextafter(static_cast<float>(bounds_max[a]), std::numeric_limits<float>::infinity());
+    }
+
+    auto count = end - begin;
+    if (count <= 4) {
+        node.offset = static_cast<uint32_t>(begin);
+        node.count = static_cast<uint16_t>(count);
+        nodes[index] = node;
+        return index;
+    }
+
+    // Median split along the widest spread of centroids, rounded so the left
+    // half fills whole leaves
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (centre_max[a] - centre_min[a] > centre_max[axis] - centre_min[axis])
+            axis = a;
+    }
+    auto mid = begin + (count + 7) / 8 * 4;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    build_node(order, centroids, begin, mid);
+    node.offset = build_node(order, centroids, mid, end);
+    node.axis = static_cast<uint16_t>(axis);
+    nodes[index] = node;
+    return index;
+}
+
+// Slab test of a ray against a node's box, limited to (t_min, t_max)
+inline bool hit_node_bounds(const mesh_bvh_node& node, const point3& origin, const vec3& inv_dir, double t_min,
+                            double t_max) {
+    for (int a = 0; a < 3; a++) {
+        auto t0 = (node.bounds_min[a] - origin[a]) * inv_dir[a];
+        auto t1 = (node.bounds_max[a] - origin[a]) * inv_dir[a];
+        if (inv_dir[a] < 0.0)
+            std::swap(t0, t1);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max < t_min)
+            return false;
+    }
+    return true;
+}
+
+// Copies a leaf's faces out of the shared buffers into kernel layout
+void triangle_mesh::gather_block(const mesh_bvh_node& leaf, triangle_block& b) const {
+    for (int lane = 0; lane < 4; lane++) {
+        point3 v0;
+        vec3 e1, e2;
+        // Unused lanes stay as all-zero (degenerate) triangles
+        if (lane < leaf.count) {
+            const int* face = &indices[3 * (static_cast<size_t>(leaf.offset) + lane)];
+            v0 = vertices[face[0]];
+            e1 = vertices[face[1]] - v0;
+            e2 = vertices[face[2]] - v0;
+        }
+        b.v0x[lane] = v0.x();
+        b.v0y[lane] = v0.y();
+        b.v0z[lane] = v0.z();
+        b.e1x[lane] = e1.x();
+        b.e1y[lane] = e1.y();
+        b.e1z[lane] = e1.z();
+        b.e2x[lane] = e2.x();
+        b.e2y[lane] = e2.y();
+        b.e2z[lane] = e2.z();
+    }
+}
+
+bool triangle_mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (nodes.empty())
+        return false;
+
+    const point3 origin = r.origin();
+    const vec3 inv_dir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+    long closest_face = -1;
+    auto closest_so_far = t_max;
+
+    // A median split tree over 2^32 faces is at most 32 levels deep
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        auto index = stack[--top];
+        const auto& node = nodes[index];
+        // Boxes beyond the closest hit so far are skipped whole
+        if (!hit_node_bounds(node, origin, inv_dir, t_min, closest_so_far))
+            continue;
+
+        if (node.count > 0) {
+            triangle_block b;
+            gather_block(node, b);
+            int lane = hit_triangle_block(b, r, t_min, closest_so_far, closest_so_far);
+            if (lane >= 0)
+                closest_face = static_cast<long>(node.offset) + lane;
+        } else if (r.direction()[node.axis] < 0) {
+            // Visit the nearer child first, so it is pushed last
+            stack[top++] = index + 1;
+            stack[top++] = node.offset;
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = index + 1;
+        }
+    }
+    if (closest_face < 0)
+        return false;
+
+    const int* face = &indices[3 * closest_face];
+    vec3 e1 = vertices[face[1]] - vertices[face[0]];
+    vec3 e2 = vertices[face[2]] - vertices[face[0]];
+
+    rec.t = closest_so_far;
+    rec.p = r.at(rec.t);
+    // Faces are wound counter-clockwise when seen from outside
+    rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+    rec.mat_ptr = mat_ptr;
+    return true;
+}